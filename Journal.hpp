@@ -0,0 +1,632 @@
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <atomic>
+#include <algorithm>
+#include <exception>
+#include <stdexcept>
+#include <system_error>
+#include <type_traits>
+#include <cstring>
+#include <cerrno>
+#include <cstdint>
+#include <fcntl.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include "Map.hpp"
+
+
+#ifndef JOURNAL_HPP
+#define JOURNAL_HPP
+
+//=======================DURABILITY===================================
+enum class Durability {
+    None,       // every record is written before the mutation returns; the log is never fsync'd
+    Batched,    // every record is written; group commit fsyncs once every batchSize records, or
+                // within maxDelay of the oldest unsynced record if that comes first
+    Always      // every record is written and fsync'd before the mutation returns
+};
+
+struct JournalStats {
+    std::size_t records;            // mutation records appended since startup
+    std::uint64_t logBytes;         // bytes appended to the log since startup
+    std::uint64_t snapshotBytes;    // bytes written by compactions since startup
+    std::size_t syncs;              // fsync calls on the log
+    std::size_t recovered;          // records replayed from disk at startup
+};
+
+//=======================FILE HELPERS===================================
+
+inline void throwErrno(const std::string &what) {
+    throw std::system_error(errno, std::generic_category(), what);
+}
+
+inline void writeAll(int fd, const char *data, std::size_t len, const std::string &path) {
+    while (len > 0) {
+        ssize_t n = ::write(fd, data, len);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            throwErrno("write " + path);
+        }
+        data += n;
+        len -= n;
+    }
+}
+
+// Returns false if the file does not exist.
+inline bool readAll(const std::string &path, std::string &out) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        if (errno == ENOENT)
+            return false;
+        throwErrno("open " + path);
+    }
+    char buf[1 << 16];
+    out.clear();
+    for (;;) {
+        ssize_t n = ::read(fd, buf, sizeof(buf));
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            ::close(fd);
+            throwErrno("read " + path);
+        }
+        if (n == 0)
+            break;
+        out.append(buf, n);
+    }
+    ::close(fd);
+    return true;
+}
+
+// Makes renames and unlinks inside the directory holding path durable.
+inline void syncDirectory(const std::string &path) {
+    std::string::size_type slash = path.rfind('/');
+    std::string dir = (slash == std::string::npos) ? "." : (slash == 0 ? "/" : path.substr(0, slash));
+    int fd = ::open(dir.c_str(), O_RDONLY);
+    if (fd < 0)
+        throwErrno("open " + dir);
+    ::fsync(fd);
+    ::close(fd);
+}
+
+//=======================RECORD CODEC===================================
+// Binary encoding of keys and values. Trivially copyable types are stored as their raw bytes and
+// std::string as a length followed by its contents; other types need a specialization.
+inline void putWord(std::string &out, std::uint32_t word) {
+    word = htonl(word);
+    out.append(reinterpret_cast<const char *>(&word), sizeof(word));
+}
+
+inline bool getWord(const char *&pos, const char *end, std::uint32_t &word) {
+    if (end - pos < static_cast<long>(sizeof(word)))
+        return false;
+    std::memcpy(&word, pos, sizeof(word));
+    word = ntohl(word);
+    pos += sizeof(word);
+    return true;
+}
+
+template<typename T>
+struct JournalCodec {
+    static_assert(std::is_trivially_copyable<T>::value, "JournalCodec needs a specialization for this type");
+    static void encode(std::string &out, const T &v) {
+        out.append(reinterpret_cast<const char *>(&v), sizeof(T));
+    }
+    static bool decode(const char *&pos, const char *end, T &v) {
+        if (end - pos < static_cast<long>(sizeof(T)))
+            return false;
+        std::memcpy(&v, pos, sizeof(T));
+        pos += sizeof(T);
+        return true;
+    }
+};
+
+template<>
+struct JournalCodec<std::string> {
+    static void encode(std::string &out, const std::string &v) {
+        putWord(out, v.size());
+        out.append(v);
+    }
+    static bool decode(const char *&pos, const char *end, std::string &v) {
+        std::uint32_t len;
+        if (!getWord(pos, end, len) || static_cast<std::uint32_t>(end - pos) < len)
+            return false;
+        v.assign(pos, len);
+        pos += len;
+        return true;
+    }
+};
+
+// FNV-1a, enough to tell a torn or garbled record from a complete one.
+inline std::uint32_t recordChecksum(const char *data, std::size_t len) {
+    std::uint32_t hash = 2166136261u;
+    for (std::size_t i = 0; i < len; i++) {
+        hash ^= static_cast<unsigned char>(data[i]);
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+const char OP_PUT='P',OP_ERASE='E',OP_CLEAR='C';
+
+//=======================JOURNALED MAP===================================
+// A Map whose mutations are appended to <path>.log before they are applied, and which rebuilds
+// itself from <path>.snap and the log on construction. Each record reaches the OS before the
+// mutation returns, so a process crash loses nothing; the durability level only decides how
+// often the log is fsync'd against power loss.
+//
+// compact() rotates the log to <path>.log.old and a background thread snapshots the map through
+// a Map::Reader while the writer carries on. The snapshot may therefore include some mutations
+// made after the rotation, which is harmless: recovery replays the whole new log on top, and the
+// last operation on each key wins. The old log is removed only once the snapshot is durable.
+//
+// Record layout: op (1 byte), payload length (4 bytes), payload, checksum of op + payload
+// (4 bytes). The payload of a put is the encoded key followed by the encoded value, of an erase
+// the encoded key, and of a clear empty. A snapshot is a sequence of puts in key order.
+//
+// Values are changed through assign() rather than operator[], because a reference handed out by
+// the underlying Map could be written without going through the journal.
+//
+// A mutation whose record cannot be written throws and is not applied; the partial record is
+// truncated away so the log stays replayable. If that truncation or any fsync of the log fails,
+// the state on disk is unknown and every later mutation throws std::system_error.
+template<typename Key_T, typename Mapped_T>
+class JournaledMap {
+public:
+    typedef typename Map<Key_T, Mapped_T>::ConstIterator ConstIterator;
+
+    // Under Batched a background thread fsyncs records left unsynced for maxDelay; a zero delay
+    // disables it, leaving records unsynced until batchSize of them pile up or sync() is called.
+    explicit JournaledMap(const std::string &path, Durability durability = Durability::Batched,
+                          std::size_t batchSize = 64,
+                          std::chrono::milliseconds maxDelay = std::chrono::milliseconds(50));
+    JournaledMap(const JournaledMap &) = delete;
+    JournaledMap &operator=(const JournaledMap &) = delete;
+    ~JournaledMap();
+
+    const Map<Key_T, Mapped_T> &map() const { return contents; }
+    std::size_t size() const { return contents.size(); }
+    bool empty() const { return contents.empty(); }
+    ConstIterator find(const Key_T &key) const { return contents.find(key); }
+    const Mapped_T &at(const Key_T &key) const { return contents.at(key); }
+
+    std::pair<ConstIterator, bool> insert(const std::pair<Key_T, Mapped_T> &);
+    void assign(const Key_T &, const Mapped_T &);
+    void erase(const Key_T &);
+    void clear();
+
+    // Fsyncs the log regardless of the durability level.
+    void sync();
+    // Starts folding the current contents into a new snapshot in the background. Waits for a
+    // compaction that is still running first.
+    void compact();
+    // Waits for a running compaction and rethrows anything it failed with.
+    void waitForCompaction();
+    JournalStats stats() const;
+
+private:
+    struct Record {
+        char op;
+        Key_T key;
+        Mapped_T value;
+    };
+
+    static void encodeRecord(std::string &out, char op, const Key_T *key, const Mapped_T *value);
+    void append(char op, const Key_T *key, const Mapped_T *value);
+    void syncLog();
+    void syncLoop();
+    void fail(int error);
+    void checkFailure() const;
+    std::size_t parse(const std::string &data, std::vector<Record> &records) const;
+    void recover();
+    void openLog();
+    void encodeSnapshot(std::string &out) const;
+    void writeSnapshot(const std::string &out);
+
+    std::string logPath, oldLogPath, snapPath;
+    Durability durability;
+    std::size_t batchSize;
+    std::chrono::milliseconds maxDelay;
+    int fd;
+    std::uint64_t logSize;                  // end of the last complete record in the log
+    std::atomic<std::uint64_t> written;     // records written to the log so far
+    std::atomic<std::uint64_t> synced;      // records covered by an fsync
+    std::atomic<int> failure;               // errno that left the log in an unknown state, or 0
+    Map<Key_T, Mapped_T> contents;
+
+    // The syncer thread fsyncs under syncMutex, which the writer also holds while it replaces fd.
+    std::thread syncer;
+    std::mutex syncMutex;
+    std::condition_variable syncWake;
+    bool stopping;
+
+    std::thread compactor;
+    std::exception_ptr compactError;
+    JournalStats counters;
+    std::atomic<std::size_t> syncs;
+    std::atomic<std::uint64_t> snapshotBytes;
+};
+
+//**************************************IMPLEMENTATION****************************************************
+
+template<typename Key_T, typename Mapped_T>
+JournaledMap<Key_T, Mapped_T>::JournaledMap(const std::string &path, Durability d, std::size_t batch,
+                                            std::chrono::milliseconds delay)
+        : logPath(path + ".log"), oldLogPath(path + ".log.old"), snapPath(path + ".snap"),
+          durability(d), batchSize(batch ? batch : 1), maxDelay(delay), fd(-1), logSize(0), written(0),
+          synced(0), failure(0), stopping(false), counters(), syncs(0), snapshotBytes(0) {
+    recover();
+    if (durability == Durability::Batched && maxDelay.count() > 0)
+        syncer = std::thread([this] { syncLoop(); });
+}
+
+template<typename Key_T, typename Mapped_T>
+JournaledMap<Key_T, Mapped_T>::~JournaledMap() {
+    if (syncer.joinable()) {
+        {
+            std::lock_guard<std::mutex> guard(syncMutex);
+            stopping = true;
+        }
+        syncWake.notify_one();
+        syncer.join();
+    }
+    try {
+        if (durability != Durability::None)
+            syncLog();
+    } catch (...) {
+    }
+    if (compactor.joinable())
+        compactor.join();
+    if (fd >= 0)
+        ::close(fd);
+}
+
+//==============================MODIFIERS===============================================================
+
+template<typename Key_T, typename Mapped_T>
+std::pair<typename JournaledMap<Key_T, Mapped_T>::ConstIterator, bool>
+JournaledMap<Key_T, Mapped_T>::insert(const std::pair<Key_T, Mapped_T> &pair) {
+    typename Map<Key_T, Mapped_T>::Iterator pos = contents.find(pair.first);
+    if (pos != contents.end())
+        return std::pair<ConstIterator, bool>(ConstIterator(pos), false);
+    append(OP_PUT, &pair.first, &pair.second);
+    return std::pair<ConstIterator, bool>(contents.insert(pair).first, true);
+}
+
+template<typename Key_T, typename Mapped_T>
+void JournaledMap<Key_T, Mapped_T>::assign(const Key_T &key, const Mapped_T &value) {
+    append(OP_PUT, &key, &value);
+    if (compactor.joinable()) {
+        // A compaction may be reading the stored value; replace the node instead of writing it.
+        if (contents.find(key) != contents.end())
+            contents.erase(key);
+        contents.insert(std::pair<Key_T, Mapped_T>(key, value));
+    } else {
+        contents[key] = value;
+    }
+}
+
+template<typename Key_T, typename Mapped_T>
+void JournaledMap<Key_T, Mapped_T>::erase(const Key_T &key) {
+    if (contents.find(key) == contents.end())
+        throw std::out_of_range("Not Found");
+    append(OP_ERASE, &key, nullptr);
+    contents.erase(key);
+}
+
+template<typename Key_T, typename Mapped_T>
+void JournaledMap<Key_T, Mapped_T>::clear() {
+    append(OP_CLEAR, nullptr, nullptr);
+    contents.clear();
+}
+
+template<typename Key_T, typename Mapped_T>
+void JournaledMap<Key_T, Mapped_T>::sync() {
+    syncLog();
+}
+
+//==============================COMPACTION===============================================================
+
+template<typename Key_T, typename Mapped_T>
+void JournaledMap<Key_T, Mapped_T>::compact() {
+    waitForCompaction();
+    syncLog();
+    // An old log left by a compaction that failed holds records no snapshot has yet; rotating
+    // over it would lose them. The new snapshot covers it as well, so just keep appending.
+    if (::access(oldLogPath.c_str(), F_OK) != 0) {
+        if (::rename(logPath.c_str(), oldLogPath.c_str()) < 0)
+            throwErrno("rename " + logPath);
+        {
+            std::lock_guard<std::mutex> guard(syncMutex);
+            ::close(fd);
+            fd = -1;
+            logSize = 0;
+            try {
+                openLog();
+            } catch (std::system_error &e) {
+                fail(e.code().value());
+                throw;
+            }
+        }
+        syncDirectory(logPath);
+    }
+
+    contents.enableConcurrentReads();
+    compactor = std::thread([this] {
+        try {
+            std::string out;
+            {
+                typename Map<Key_T, Mapped_T>::Reader reader(contents);
+                std::lock_guard<typename Map<Key_T, Mapped_T>::Reader> guard(reader);
+                encodeSnapshot(out);
+            }
+            writeSnapshot(out);
+            if (::unlink(oldLogPath.c_str()) < 0)
+                throwErrno("unlink " + oldLogPath);
+            syncDirectory(oldLogPath);
+        } catch (...) {
+            compactError = std::current_exception();
+        }
+    });
+}
+
+template<typename Key_T, typename Mapped_T>
+void JournaledMap<Key_T, Mapped_T>::waitForCompaction() {
+    if (compactor.joinable())
+        compactor.join();
+    if (compactError) {
+        std::exception_ptr error = compactError;
+        compactError = nullptr;
+        std::rethrow_exception(error);
+    }
+}
+
+template<typename Key_T, typename Mapped_T>
+JournalStats JournaledMap<Key_T, Mapped_T>::stats() const {
+    JournalStats res = counters;
+    res.syncs = syncs.load();
+    res.snapshotBytes = snapshotBytes.load();
+    return res;
+}
+
+//============================================HELPERS===================================================
+
+template<typename Key_T, typename Mapped_T>
+void JournaledMap<Key_T, Mapped_T>::encodeRecord(std::string &out, char op, const Key_T *key, const Mapped_T *value) {
+    std::string::size_type start = out.size();
+    out.push_back(op);
+    putWord(out, 0);
+    if (key)
+        JournalCodec<Key_T>::encode(out, *key);
+    if (value)
+        JournalCodec<Mapped_T>::encode(out, *value);
+
+    std::uint32_t payload = htonl(out.size() - start - 1 - sizeof(payload));
+    std::memcpy(&out[start + 1], &payload, sizeof(payload));
+    putWord(out, recordChecksum(out.data() + start, out.size() - start));
+}
+
+// Writes one record, fsyncing as the durability level asks. On failure the record is cut off
+// the log again, since the caller will not apply the mutation it describes.
+template<typename Key_T, typename Mapped_T>
+void JournaledMap<Key_T, Mapped_T>::append(char op, const Key_T *key, const Mapped_T *value) {
+    checkFailure();
+    std::string record;
+    encodeRecord(record, op, key, value);
+    try {
+        writeAll(fd, record.data(), record.size(), logPath);
+    } catch (std::system_error &) {
+        if (::ftruncate(fd, logSize) < 0)
+            fail(errno);
+        throw;
+    }
+    logSize += record.size();
+    written.store(written.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    try {
+        std::uint64_t behind = written.load(std::memory_order_relaxed) - synced.load(std::memory_order_acquire);
+        if (durability == Durability::Always || (durability == Durability::Batched && behind >= batchSize))
+            syncLog();
+    } catch (std::system_error &) {
+        logSize -= record.size();
+        if (::ftruncate(fd, logSize) < 0)
+            fail(errno);
+        throw;
+    }
+    counters.records++;
+    counters.logBytes += record.size();
+}
+
+// Fsyncs every record written so far. Called by the writer, the syncer and the compactor; a
+// failed fsync may have dropped dirty pages, so it leaves the journal failed.
+template<typename Key_T, typename Mapped_T>
+void JournaledMap<Key_T, Mapped_T>::syncLog() {
+    checkFailure();
+    std::uint64_t target = written.load(std::memory_order_acquire);
+    if (synced.load(std::memory_order_acquire) >= target)
+        return;
+    if (::fsync(fd) < 0) {
+        fail(errno);
+        throwErrno("fsync " + logPath);
+    }
+    syncs++;
+    std::uint64_t done = synced.load(std::memory_order_relaxed);
+    while (done < target && !synced.compare_exchange_weak(done, target, std::memory_order_release))
+        ;
+}
+
+// Bounds how long a record may stay unsynced under Batched: every maxDelay, whatever has been
+// written since the last fsync gets one.
+template<typename Key_T, typename Mapped_T>
+void JournaledMap<Key_T, Mapped_T>::syncLoop() {
+    std::unique_lock<std::mutex> lock(syncMutex);
+    while (!stopping) {
+        syncWake.wait_for(lock, maxDelay);
+        try {
+            if (!stopping)
+                syncLog();
+        } catch (std::system_error &) {
+            return;
+        }
+    }
+}
+
+template<typename Key_T, typename Mapped_T>
+void JournaledMap<Key_T, Mapped_T>::fail(int error) {
+    int expected = 0;
+    failure.compare_exchange_strong(expected, error);
+}
+
+template<typename Key_T, typename Mapped_T>
+void JournaledMap<Key_T, Mapped_T>::checkFailure() const {
+    int error = failure.load();
+    if (error != 0)
+        throw std::system_error(error, std::generic_category(), "journal " + logPath + " failed");
+}
+
+// Decodes complete records from data and returns the number of bytes they span. Decoding stops
+// at the first truncated or corrupt record, which is what a crash mid-append leaves behind.
+template<typename Key_T, typename Mapped_T>
+std::size_t JournaledMap<Key_T, Mapped_T>::parse(const std::string &data, std::vector<Record> &records) const {
+    const char *begin = data.data(), *pos = begin, *end = begin + data.size();
+    for (;;) {
+        const char *start = pos;
+        std::uint32_t payload, checksum;
+        Record rec = Record();
+        if (pos == end)
+            return start - begin;
+        pos++;
+        if (!getWord(pos, end, payload) || static_cast<std::uint32_t>(end - pos) < payload)
+            return start - begin;
+        const char *body = pos, *bodyEnd = pos + payload;
+        pos = bodyEnd;
+        if (!getWord(pos, end, checksum) || checksum != recordChecksum(start, bodyEnd - start))
+            return start - begin;
+
+        rec.op = *start;
+        bool ok = (rec.op == OP_PUT || rec.op == OP_ERASE || rec.op == OP_CLEAR);
+        if (ok && rec.op != OP_CLEAR)
+            ok = JournalCodec<Key_T>::decode(body, bodyEnd, rec.key);
+        if (ok && rec.op == OP_PUT)
+            ok = JournalCodec<Mapped_T>::decode(body, bodyEnd, rec.value);
+        if (!ok || body != bodyEnd)
+            return start - begin;
+        records.push_back(rec);
+    }
+}
+
+// Rebuilds the contents from the snapshot, an old log left by an unfinished compaction, and the
+// current log, in that order. Log records are folded down to the last operation on each key and
+// merged with the sorted snapshot, so the Map is built in one pass rather than by per-record
+// inserts.
+template<typename Key_T, typename Mapped_T>
+void JournaledMap<Key_T, Mapped_T>::recover() {
+    std::string data;
+    std::vector<Record> snapshot, log;
+    if (readAll(snapPath, data))
+        parse(data, snapshot);
+    bool oldLog = readAll(oldLogPath, data);
+    if (oldLog)
+        parse(data, log);
+    std::size_t valid = 0, replayed = log.size();
+    if (readAll(logPath, data))
+        valid = parse(data, log);
+    counters.recovered = log.size();
+    // Records a crashed process left in the log may never have been fsync'd.
+    written.store(log.size() - replayed);
+
+    std::size_t lastClear = log.size();
+    for (std::size_t i = 0; i < log.size(); i++) {
+        if (log[i].op == OP_CLEAR)
+            lastClear = i;
+    }
+    if (lastClear != log.size()) {
+        snapshot.clear();
+        log.erase(log.begin(), log.begin() + lastClear + 1);
+    }
+    std::stable_sort(log.begin(), log.end(), [](const Record &a, const Record &b) {
+        return a.key < b.key;
+    });
+
+    std::vector<std::pair<Key_T, Mapped_T>> items;
+    items.reserve(snapshot.size() + log.size());
+    std::size_t s = 0, l = 0;
+    while (s < snapshot.size() || l < log.size()) {
+        if (l == log.size() || (s < snapshot.size() && snapshot[s].key < log[l].key)) {
+            items.push_back(std::pair<Key_T, Mapped_T>(snapshot[s].key, snapshot[s].value));
+            s++;
+            continue;
+        }
+        while (l + 1 < log.size() && log[l + 1].key == log[l].key)
+            l++;
+        if (s < snapshot.size() && snapshot[s].key == log[l].key)
+            s++;
+        if (log[l].op == OP_PUT)
+            items.push_back(std::pair<Key_T, Mapped_T>(log[l].key, log[l].value));
+        l++;
+    }
+    contents.assignSorted(items.begin(), items.end());
+
+    openLog();
+    if (oldLog) {
+        // A compaction was interrupted; finish it with the recovered contents. The log may only
+        // be emptied once the old log is gone for good, or a later recovery would replay the old
+        // log over a snapshot that already holds newer values.
+        std::string out;
+        encodeSnapshot(out);
+        writeSnapshot(out);
+        if (::unlink(oldLogPath.c_str()) < 0)
+            throwErrno("unlink " + oldLogPath);
+        syncDirectory(oldLogPath);
+        valid = 0;
+    }
+    if (::ftruncate(fd, valid) < 0)
+        throwErrno("truncate " + logPath);
+    if (::fsync(fd) < 0)
+        throwErrno("fsync " + logPath);
+    synced.store(written.load());
+    logSize = valid;
+}
+
+template<typename Key_T, typename Mapped_T>
+void JournaledMap<Key_T, Mapped_T>::openLog() {
+    fd = ::open(logPath.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (fd < 0)
+        throwErrno("open " + logPath);
+}
+
+template<typename Key_T, typename Mapped_T>
+void JournaledMap<Key_T, Mapped_T>::encodeSnapshot(std::string &out) const {
+    for (ConstIterator it = map().begin(); it != map().end(); it++)
+        encodeRecord(out, OP_PUT, &it->first, &it->second);
+}
+
+// The live log is fsync'd before the snapshot replaces the old one: every mutation the snapshot
+// reflects was written to the log first, so this keeps the snapshot from getting ahead of it.
+template<typename Key_T, typename Mapped_T>
+void JournaledMap<Key_T, Mapped_T>::writeSnapshot(const std::string &out) {
+    std::string tmpPath = snapPath + ".tmp";
+    int snapFd = ::open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (snapFd < 0)
+        throwErrno("open " + tmpPath);
+    try {
+        writeAll(snapFd, out.data(), out.size(), tmpPath);
+        if (::fsync(snapFd) < 0)
+            throwErrno("fsync " + tmpPath);
+    } catch (...) {
+        ::close(snapFd);
+        throw;
+    }
+    ::close(snapFd);
+    syncLog();
+    if (::rename(tmpPath.c_str(), snapPath.c_str()) < 0)
+        throwErrno("rename " + tmpPath);
+    syncDirectory(snapPath);
+    snapshotBytes += out.size();
+}
+
+#endif
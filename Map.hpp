@@ -1,7 +1,13 @@
 #include <iostream>
 #include <vector>
+#include <algorithm>
 #include <string>
 #include <random>
+#include <cstdint>
+#include <atomic>
+#include <stdexcept>
+#include <new>
+#include <cstdlib>
 #include <netinet/in.h>
 #include <cassert>
 
@@ -15,49 +21,129 @@ bool isHeads()
     return (n>=0.5);
 }
 
+const char HEAD='H',TAIL='T';
+const std::size_t MAX_HEIGHT=32,MAX_READERS=64,RECLAIM_BATCH=64;
+
 std::size_t getRandomHeight()
 {
     std::size_t res=1;
-    while (isHeads())
+    while (res < MAX_HEIGHT && isHeads())
         res++;
     return res;
 }
 
-const char HEAD='H',TAIL='T';
+//=======================KEY PREFIX===================================
+// Order-preserving summary of a key, cached in every DataNode so that most comparisons during a
+// search are settled without dereferencing the key itself. Each Map picks one Reference, built
+// from the first key it holds, and every prefix is taken relative to it. compare() returns the
+// order of the two keys, or 0 when the prefixes cannot tell and the keys must be compared.
+// Keys without a specialization carry no prefix and always fall through to a full comparison.
+template<typename Key_T>
+struct KeyPrefix {
+    struct Reference {
+        explicit Reference(const Key_T &) {}
+    };
+    KeyPrefix(const Key_T &, const Reference *) {}
+    int compare(const KeyPrefix &) const { return 0; }
+};
+
+// Keys in one map tend to share a long leading run ("https://host/api/...", "/usr/local/..."),
+// so their first bytes say nothing. Instead each prefix records how far its key agrees with the
+// reference, which side of the reference the key falls on where they part, and the next sixteen
+// bytes of the key packed big-endian and zero padded. Two keys that part from the reference at
+// different offsets are ordered by those offsets alone: the one that leaves first sorts on its
+// own side of everything that stays longer. Keys that part at the same offset share everything
+// before it and are ordered by their next sixteen bytes, which orders them the same way
+// std::string::operator< does whenever the bytes differ.
+template<>
+struct KeyPrefix<std::string> {
+    typedef std::string Reference;
+    std::uint32_t offset;   // length of the run shared with the reference
+    std::int32_t side;      // key versus reference past that run: -1, 1, or 0 if not known
+    std::uint64_t value[2];
+    KeyPrefix(const std::string &key, const Reference *reference) : offset(0), side(0), value() {
+        if (reference) {
+            std::size_t shared = std::min<std::size_t>(std::min(key.size(), reference->size()), UINT32_MAX);
+            while (offset < shared && key[offset] == (*reference)[offset])
+                offset++;
+            if (offset < shared)
+                side = static_cast<unsigned char>(key[offset]) < static_cast<unsigned char>((*reference)[offset]) ? -1 : 1;
+            else if (key.size() != reference->size() && offset == std::min(key.size(), reference->size()))
+                side = key.size() < reference->size() ? -1 : 1;
+        }
+        for (std::size_t i = 0; i < sizeof(value); i++) {
+            value[i / sizeof(value[0])] <<= 8;
+            if (offset + i < key.size())
+                value[i / sizeof(value[0])] |= static_cast<unsigned char>(key[offset + i]);
+        }
+    }
+    int compare(const KeyPrefix &p) const {
+        if (offset < p.offset)
+            return side;
+        if (offset > p.offset)
+            return -p.side;
+        if (value[0] != p.value[0])
+            return (value[0] < p.value[0]) ? -1 : 1;
+        return (value[1] < p.value[1]) ? -1 : (value[1] > p.value[1]);
+    }
+};
+
 template<typename Key_T, typename Mapped_T>
 class Map {
     typedef std::pair<Key_T, Mapped_T> ValueType;
+    typedef typename KeyPrefix<Key_T>::Reference Reference;
     //=======================SKIPNODE CLASS===================================
+    // Links are published by the single writer with release stores and followed with acquire
+    // loads, so readers can traverse the list while it is being modified. The head and tail
+    // sentinels always have MAX_HEIGHT levels; levels above Map::levels point from head to tail.
+    //
+    // A node's tower lives in the same allocation, directly below the node: link i is the
+    // (i + 1)th slot beneath it. Level 0 thus shares a cache line with the node's header, prefix
+    // and usually its key. Nodes are made by newSentinel()/newDataNode() and freed by deleteNode().
     class SkipNode {
     public:
         char type;
         std::size_t height;
-        std::vector<SkipNode *> forward_ptrs;
-        SkipNode *prev;
-        explicit SkipNode(std::size_t h) : type('\0'), height(h), prev(0) {
-            for (int i = 0; i < height; i++)
-                forward_ptrs.emplace_back(nullptr);
-        }
-        explicit SkipNode(char t) : type(t), height(1), prev(0) {}
-        SkipNode(const SkipNode &node) : prev(0) {
-            type = node.type;
-            height = node.height;
-            for (int i = 0; i < height; i++)
-                forward_ptrs.emplace_back(nullptr);
+        std::atomic<SkipNode *> prev;
+        SkipNode(char t, std::size_t h) : type(t), height(h), prev(nullptr) {}
+        SkipNode *next(std::size_t i) const { return link(i).load(std::memory_order_acquire); }
+        void setNext(std::size_t i, SkipNode *node) { link(i).store(node, std::memory_order_release); }
+        SkipNode *previous() const { return prev.load(std::memory_order_acquire); }
+        void setPrevious(SkipNode *node) { prev.store(node, std::memory_order_release); }
+    private:
+        std::atomic<SkipNode *> &link(std::size_t i) const {
+            return *(reinterpret_cast<std::atomic<SkipNode *> *>(const_cast<SkipNode *>(this)) - 1 - i);
         }
-        virtual ~SkipNode() {}
     };
-    class DataNode : public SkipNode {
+    // The prefix is an empty base for keys without one, so it costs those nodes no space.
+    class DataNode : public SkipNode, public KeyPrefix<Key_T> {
     public:
         ValueType data;
-        explicit DataNode(std::pair<Key_T, Mapped_T> p, std::size_t h) : data(p), SkipNode(h) {}
-        DataNode(const DataNode &node) : SkipNode(node), data(node.data) {}
+        DataNode(const std::pair<Key_T, Mapped_T> &p, std::size_t h, const Reference *r)
+                : SkipNode('\0', h), KeyPrefix<Key_T>(p.first, r), data(p) {}
+        const KeyPrefix<Key_T> &prefix() const { return *this; }
+    };
+    // One per registered reader, padded to a cache line so readers entering and leaving do not
+    // contend with each other.
+    struct alignas(64) ReaderSlot {
+        std::atomic<bool> claimed;
+        std::atomic<std::uint64_t> epoch;   // epoch the reader entered in, 0 while it is outside
     };
 
 
     SkipNode *head;
     SkipNode *tail;
-    std::size_t nSize;
+    std::atomic<std::size_t> levels;
+    std::atomic<std::size_t> nSize;
+    // Set from the first key inserted and kept while any node holds a prefix taken against it;
+    // replaced only by clear() outside concurrent-read mode.
+    std::atomic<const Reference *> reference;
+
+    // Epoch-based reclamation of nodes unlinked by the writer. slots stays null until
+    // enableConcurrentReads(), and until then erased nodes are freed straight away.
+    std::atomic<ReaderSlot *> slots;
+    std::atomic<std::uint64_t> epoch;
+    std::vector<std::pair<SkipNode *, std::uint64_t>> retired;
 public:
     //=================================ITERATOR=======================================================
     class Iterator {
@@ -130,6 +216,36 @@ public:
         friend class Map;
     };
 
+    //=================================CONCURRENT READS=======================================================
+    // Switches the map to single-writer/multi-reader mode. Called by the writer thread before
+    // any Reader is created; calling it again does nothing.
+    void enableConcurrentReads();
+
+    // Frees every erased node that no locked reader can still reach. The writer calls this on
+    // its own every RECLAIM_BATCH erases; calling it directly releases memory sooner.
+    void reclaim();
+    // Erased nodes still waiting for readers to unlock.
+    std::size_t retiredCount() const;
+
+    // Registers a reader thread for single-writer/multi-reader use. Between lock() and unlock()
+    // the thread may call find() and traverse ConstIterators on the const Map while one writer
+    // thread keeps inserting and erasing; nodes erased meanwhile are freed only after every
+    // reader that could still see them has unlocked. lock() and unlock() use plain loads and
+    // stores, no atomic read-modify-writes. Mapped values must not be modified in place while
+    // readers are active, and all Readers must be destroyed before the Map. Throws
+    // std::logic_error if enableConcurrentReads() has not been called.
+    class Reader {
+        const Map *map;
+        ReaderSlot *slot;
+    public:
+        explicit Reader(const Map &);
+        Reader(const Reader &) = delete;
+        Reader &operator=(const Reader &) = delete;
+        ~Reader();
+        void lock();
+        void unlock();
+    };
+
     //=================================MAP CONSTRUCTORS=======================================================
     Map();
     Map(const Map &);
@@ -159,6 +275,9 @@ public:
     //==============================MODIFIERS===============================================================
     std::pair<Iterator, bool> insert(const std::pair<Key_T, Mapped_T> &);
     template <typename IT_T> void insert(IT_T range_beg, IT_T range_end);
+    // Replaces the contents with a range whose keys are strictly ascending, linking each node
+    // at the end of every level instead of searching for its position.
+    template <typename IT_T> void assignSorted(IT_T range_beg, IT_T range_end);
     void erase(const Key_T &);
     void erase(Iterator pos);
     void clear();
@@ -174,7 +293,14 @@ public:
     //=================================HELPERS====================================================
 private:
     SkipNode *findNode(const Key_T&) const;
-    void addEmptyLayer();
+    static std::size_t towerBytes(std::size_t, std::size_t);
+    static SkipNode *newSentinel(char);
+    SkipNode *newDataNode(const std::pair<Key_T, Mapped_T> &, std::size_t);
+    KeyPrefix<Key_T> prefixOf(const Key_T &) const;
+    static void deleteNode(SkipNode *);
+    static bool keyLess(const SkipNode *, const Key_T &, const KeyPrefix<Key_T> &);
+    static bool keyEquals(const SkipNode *, const Key_T &, const KeyPrefix<Key_T> &);
+    void retire(SkipNode *);
 };
 
 //**************************************IMPLEMENTATION****************************************************
@@ -182,59 +308,21 @@ private:
 //=================================MAP CONSTRUCTORS=======================================================
 
 template<typename Key_T, typename Mapped_T>
-Map<Key_T, Mapped_T>::Map():nSize(0) {
-    head = new SkipNode(HEAD);
-    tail = new SkipNode(TAIL);
-    head->forward_ptrs.push_back(tail);
-    tail->forward_ptrs.emplace_back(nullptr);
+Map<Key_T, Mapped_T>::Map():levels(1), nSize(0), reference(nullptr), slots(nullptr), epoch(1) {
+    head = newSentinel(HEAD);
+    tail = newSentinel(TAIL);
+    for (std::size_t i = 0; i < MAX_HEIGHT; i++)
+        head->setNext(i, tail);
+    tail->setPrevious(head);
 }
 
 template<typename Key_T, typename Mapped_T>
-Map<Key_T, Mapped_T>::Map(const Map &map) {
-    Map<Key_T, Mapped_T>::SkipNode *orgl = map.head, *curr = orgl, *tmp;
-
-    while (curr) {
-        tmp = curr->forward_ptrs[0];
-
-        curr->forward_ptrs[0] = (curr->type == '\0') ? new DataNode(*static_cast<DataNode *>(curr))
-                                                     : new SkipNode(*curr);
-        curr->forward_ptrs[0]->forward_ptrs[0] = tmp;
-        curr = tmp;
-    }
-
-    curr = orgl;
-
-
-    while (curr) {
-        for (int i = 1; i < curr->forward_ptrs.size(); i++) {
-            curr->forward_ptrs[0]->forward_ptrs[i] = curr->forward_ptrs[i] ? curr->forward_ptrs[i]->forward_ptrs[0]
-                                                                           : curr->forward_ptrs[i];
-        }
-        curr->forward_ptrs[0]->prev = curr->prev ? curr->prev->forward_ptrs[0] : curr->prev;
-        curr = curr->forward_ptrs[0] ? curr->forward_ptrs[0]->forward_ptrs[0] : curr->forward_ptrs[0];
-    }
-
-    Map<Key_T, Mapped_T>::SkipNode *org = orgl, *copy = orgl->forward_ptrs[0];
-
-    tmp = copy;
-    while (org && copy) {
-        org->forward_ptrs[0] = org->forward_ptrs[0] ?
-                               org->forward_ptrs[0]->forward_ptrs[0] : org->forward_ptrs[0];
-        copy->forward_ptrs[0] = copy->forward_ptrs[0] ?
-                                copy->forward_ptrs[0]->forward_ptrs[0] : copy->forward_ptrs[0];
-        org = org->forward_ptrs[0];
-        if (copy->type == TAIL)
-            this->tail = copy;
-        copy = copy->forward_ptrs[0];
-    }
-    nSize = map.nSize;
-    head = tmp;
-
+Map<Key_T, Mapped_T>::Map(const Map &map):Map() {
+    assignSorted(map.begin(), map.end());
 }
 
 template<typename Key_T, typename Mapped_T>
 Map<Key_T, Mapped_T>::Map(std::initializer_list<std::pair<const Key_T, Mapped_T>> list):Map() {
-    nSize=0;
     auto *start = list.begin();
     for (; start != list.end(); start++) {
         insert(*(start));
@@ -247,47 +335,7 @@ Map<Key_T, Mapped_T> &Map<Key_T, Mapped_T>::operator=(const Map<Key_T, Mapped_T>
     {
         return *this;
     }
-    Map<Key_T, Mapped_T>::SkipNode *orgl = map.head, *curr = orgl, *tmp;
-    clear();
-    delete head;
-    delete tail;
-    while (curr) {
-        tmp = curr->forward_ptrs[0];
-
-        curr->forward_ptrs[0] = (curr->type == '\0') ? new DataNode(*static_cast<DataNode *>(curr))
-                                                     : new SkipNode(*curr);
-        curr->forward_ptrs[0]->forward_ptrs[0] = tmp;
-        curr = tmp;
-    }
-
-    curr = orgl;
-
-
-    while (curr) {
-        for (int i = 1; i < curr->forward_ptrs.size(); i++) {
-            curr->forward_ptrs[0]->forward_ptrs[i] = curr->forward_ptrs[i] ? curr->forward_ptrs[i]->forward_ptrs[0]
-                                                                           : curr->forward_ptrs[i];
-        }
-        curr->forward_ptrs[0]->prev = curr->prev ? curr->prev->forward_ptrs[0] : curr->prev;
-        curr = curr->forward_ptrs[0] ? curr->forward_ptrs[0]->forward_ptrs[0] : curr->forward_ptrs[0];
-    }
-
-    Map<Key_T, Mapped_T>::SkipNode *org = orgl, *copy = orgl->forward_ptrs[0];
-
-    tmp = copy;
-    while (org && copy) {
-        org->forward_ptrs[0] = org->forward_ptrs[0] ?
-                               org->forward_ptrs[0]->forward_ptrs[0] : org->forward_ptrs[0];
-        copy->forward_ptrs[0] = copy->forward_ptrs[0] ?
-                                copy->forward_ptrs[0]->forward_ptrs[0] : copy->forward_ptrs[0];
-        org = org->forward_ptrs[0];
-        if (copy->type == TAIL)
-            tail = copy;
-        copy = copy->forward_ptrs[0];
-    }
-
-    head = tmp;
-    nSize = map.nSize;
+    assignSorted(map.begin(), map.end());
     return *this;
 }
 
@@ -296,29 +344,33 @@ Map<Key_T, Mapped_T>::~Map() {
     SkipNode *tmp;
     while (head != tail) {
         tmp = head;
-        head = head->forward_ptrs[0];
-        delete tmp;
+        head = head->next(0);
+        deleteNode(tmp);
     }
-    delete tail;
+    deleteNode(tail);
+    for (auto &node : retired)
+        deleteNode(node.first);
+    delete reference.load();
+    std::free(slots.load());
 }
 
 //=======================================SIZE OPERATORS====================================================
 
 template<typename Key_T, typename Mapped_T>
 size_t Map<Key_T, Mapped_T>::size() const {
-    return nSize;
+    return nSize.load(std::memory_order_relaxed);
 }
 
 template<typename Key_T, typename Mapped_T>
 bool Map<Key_T, Mapped_T>::empty() const {
-    return (nSize == 0);
+    return (size() == 0);
 }
 
 //=================================ITERATOR OPERATIONS====================================================
 
 template<typename Key_T, typename Mapped_T>
 typename Map<Key_T, Mapped_T>::Iterator Map<Key_T, Mapped_T>::begin() {
-    Map<Key_T, Mapped_T>::Iterator iterator(head->forward_ptrs[0]);
+    Map<Key_T, Mapped_T>::Iterator iterator(head->next(0));
     return iterator;
 }
 
@@ -330,7 +382,7 @@ typename Map<Key_T, Mapped_T>::Iterator Map<Key_T, Mapped_T>::end() {
 
 template<typename Key_T, typename Mapped_T>
 typename Map<Key_T, Mapped_T>::ConstIterator Map<Key_T, Mapped_T>::begin() const {
-    return ConstIterator(head->forward_ptrs[0]);
+    return ConstIterator(head->next(0));
 }
 
 template<typename Key_T, typename Mapped_T>
@@ -340,7 +392,7 @@ typename Map<Key_T, Mapped_T>::ConstIterator Map<Key_T, Mapped_T>::end() const {
 
 template<typename Key_T, typename Mapped_T>
 typename Map<Key_T, Mapped_T>::ReverseIterator Map<Key_T, Mapped_T>::rbegin() {
-    return ReverseIterator(tail->prev);
+    return ReverseIterator(tail->previous());
 }
 
 template<typename Key_T, typename Mapped_T>
@@ -403,44 +455,45 @@ Mapped_T &Map<Key_T,Mapped_T>::operator[](const Key_T &key) {
 template<typename Key_T, typename Mapped_T>
 std::pair<typename Map<Key_T,Mapped_T>::Iterator, bool> Map<Key_T, Mapped_T>::insert(const std::pair<Key_T, Mapped_T> &pair) {
     SkipNode *it = head;
+    SkipNode *bound = tail;     // where the level above stopped, known not to be less than the key
     std::size_t randomHeight = getRandomHeight();
-
-    std::vector<SkipNode *> updates;
-    for (long curr_ht_index = head->forward_ptrs.size() - 1; curr_ht_index >= 0; curr_ht_index--) {
-        while ((it->forward_ptrs[curr_ht_index] != tail) &&
-               (static_cast<DataNode *>(it->forward_ptrs[curr_ht_index])->data.first < pair.first)) {
-            it = it->forward_ptrs[curr_ht_index];
+    std::size_t top = std::max(levels.load(std::memory_order_relaxed), randomHeight);
+    if (!reference.load(std::memory_order_relaxed))
+        reference.store(new Reference(pair.first), std::memory_order_release);
+    KeyPrefix<Key_T> prefix = prefixOf(pair.first);
+
+    std::vector<SkipNode *> updates(randomHeight);
+    for (long curr_ht_index = top - 1; curr_ht_index >= 0; curr_ht_index--) {
+        SkipNode *next = it->next(curr_ht_index);
+        while ((next != tail) && (next != bound) && keyLess(next, pair.first, prefix)) {
+            it = next;
+            next = it->next(curr_ht_index);
         }
+        bound = next;
         if (curr_ht_index < randomHeight) {
-            updates.push_back(it);
+            updates[curr_ht_index] = it;
         }
     }
 
 
-    if ((it->forward_ptrs[0]->type!=TAIL)&& static_cast<DataNode *>(it->forward_ptrs[0])->data.first == pair.first) {
-        std::pair<Map<Key_T,Mapped_T>::Iterator,bool> res(Map<Key_T,Mapped_T>::Iterator(it->forward_ptrs[0]),false);
+    if ((it->next(0)->type!=TAIL)&& keyEquals(it->next(0), pair.first, prefix)) {
+        std::pair<Map<Key_T,Mapped_T>::Iterator,bool> res(Map<Key_T,Mapped_T>::Iterator(it->next(0)),false);
         return res;
     }
 
-    SkipNode *newNode = new DataNode(pair, randomHeight);
-    newNode->prev = updates[updates.size() - 1];
-    it->forward_ptrs[0]->prev = newNode;
+    // Fill in the new node before it becomes reachable, then link it bottom-up so that a node
+    // present on some level is always present on every level below it.
+    SkipNode *newNode = newDataNode(pair, randomHeight);
+    for (std::size_t i = 0; i < randomHeight; i++)
+        newNode->setNext(i, updates[i]->next(i));
+    newNode->setPrevious(it);
+    for (std::size_t i = 0; i < randomHeight; i++)
+        updates[i]->setNext(i, newNode);
+    newNode->next(0)->setPrevious(newNode);
 
-    if (randomHeight > head->forward_ptrs.size()) {
-        for (unsigned long i = head->forward_ptrs.size(); i < randomHeight; ++i) {
-            addEmptyLayer();
-            head->forward_ptrs[i] = newNode;
-            newNode->forward_ptrs[i] = tail;
-        }
-    }
-
-    std::size_t current_height = updates.size() - 1;
-    for (SkipNode *node:updates) {
-        newNode->forward_ptrs[current_height] = node->forward_ptrs[current_height];
-        node->forward_ptrs[current_height] = newNode;
-        current_height--;
-    }
-    nSize++;
+    if (randomHeight > levels.load(std::memory_order_relaxed))
+        levels.store(randomHeight, std::memory_order_release);
+    nSize.store(nSize.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
 
     return std::pair<Map<Key_T,Mapped_T>::Iterator,bool>(Iterator(newNode),true);
 }
@@ -455,31 +508,61 @@ void Map<Key_T,Mapped_T>::insert(IT_T range_beg, IT_T range_end) {
     }
 }
 
+template <typename Key_T,typename Mapped_T>
+template<typename IT_T>
+void Map<Key_T,Mapped_T>::assignSorted(IT_T range_beg, IT_T range_end) {
+    clear();
+    if (range_beg != range_end && !reference.load(std::memory_order_relaxed))
+        reference.store(new Reference((*range_beg).first), std::memory_order_release);
+    std::vector<SkipNode *> last(MAX_HEIGHT, head);
+    while(range_beg!=range_end)
+    {
+        assert(last[0] == head || static_cast<DataNode *>(last[0])->data.first < (*range_beg).first);
+        std::size_t randomHeight = getRandomHeight();
+        SkipNode *newNode = newDataNode(*range_beg, randomHeight);
+        for (std::size_t i = 0; i < randomHeight; i++)
+            newNode->setNext(i, tail);
+        newNode->setPrevious(last[0]);
+        for (std::size_t i = 0; i < randomHeight; i++) {
+            last[i]->setNext(i, newNode);
+            last[i] = newNode;
+        }
+        tail->setPrevious(newNode);
+        if (randomHeight > levels.load(std::memory_order_relaxed))
+            levels.store(randomHeight, std::memory_order_release);
+        nSize.store(nSize.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        range_beg++;
+    }
+}
+
 template<typename Key_T, typename Mapped_T>
 void Map<Key_T, Mapped_T>::erase(const Key_T &key) {
     SkipNode *it = head;
-    std::vector<SkipNode *> updates(head->forward_ptrs);
-    for (long curr_ht_index = head->forward_ptrs.size() - 1; curr_ht_index >= 0; curr_ht_index--) {
-        while ((it->forward_ptrs[curr_ht_index] != tail) &&
-               (static_cast<DataNode *>(it->forward_ptrs[curr_ht_index])->data.first < key)) {
-            it = it->forward_ptrs[curr_ht_index];
+    SkipNode *bound = tail;     // where the level above stopped, known not to be less than the key
+    KeyPrefix<Key_T> prefix = prefixOf(key);
+    std::vector<SkipNode *> updates(levels.load(std::memory_order_relaxed));
+    for (long curr_ht_index = updates.size() - 1; curr_ht_index >= 0; curr_ht_index--) {
+        SkipNode *next = it->next(curr_ht_index);
+        while ((next != tail) && (next != bound) && keyLess(next, key, prefix)) {
+            it = next;
+            next = it->next(curr_ht_index);
         }
+        bound = next;
         updates[curr_ht_index] = it;
     }
-    it = it->forward_ptrs[0];
-    if ((it->type != HEAD) && !(static_cast<DataNode *>(it)->data.first == key)) {
+    it = it->next(0);
+    if ((it == tail) || !keyEquals(it, key, prefix)) {
         throw std::out_of_range("Not Found");
     }
-    for (int i = 0, ht = updates.size() - 1; i < updates.size(); i++, ht--) {
-        if (updates[i]->forward_ptrs[i] != it) {
-            break;
-        }
-        updates[i]->forward_ptrs[i] = it->forward_ptrs[i];
+    // Unlink top-down, the reverse of insert. The node's own links are left intact so a reader
+    // standing on it can still move on.
+    for (long i = static_cast<long>(it->height) - 1; i >= 0; i--) {
+        updates[i]->setNext(i, it->next(i));
     }
-    it->forward_ptrs[0]->prev = it->prev;
-    delete it;
-    nSize--;
-    if (nSize == 0) {
+    it->next(0)->setPrevious(it->previous());
+    retire(it);
+    nSize.store(nSize.load(std::memory_order_relaxed) - 1, std::memory_order_relaxed);
+    if (nSize.load(std::memory_order_relaxed) == 0) {
         clear();
     }
 }
@@ -492,18 +575,30 @@ void Map<Key_T, Mapped_T>::erase(Map<Key_T, Mapped_T>::Iterator pos) {
 
 template<typename Key_T, typename Mapped_T>
 void Map<Key_T, Mapped_T>::clear() {
-    SkipNode *tmp;
-    while (head != tail) {
-        tmp = head;
-        head = head->forward_ptrs[0];
-        delete tmp;
+    SkipNode *tmp = head->next(0);
+    for (long i = levels.load(std::memory_order_relaxed) - 1; i >= 0; i--) {
+        head->setNext(i, tail);
+    }
+    tail->setPrevious(head);
+    levels.store(1, std::memory_order_release);
+    nSize.store(0, std::memory_order_relaxed);
+    bool shared = slots.load(std::memory_order_relaxed) != nullptr;
+    std::uint64_t current = epoch.load(std::memory_order_relaxed);
+    while (tmp != tail) {
+        SkipNode *next = tmp->next(0);
+        if (shared)
+            retired.push_back(std::pair<SkipNode *, std::uint64_t>(tmp, current));
+        else
+            deleteNode(tmp);
+        tmp = next;
+    }
+    if (shared) {
+        reclaim();
+    } else {
+        // No node refers to the reference any more, so the next key can pick a better one.
+        delete reference.load(std::memory_order_relaxed);
+        reference.store(nullptr, std::memory_order_relaxed);
     }
-    delete tail;
-    head = new SkipNode(HEAD);
-    tail = new SkipNode(TAIL);
-    head->forward_ptrs.push_back(tail);
-    tail->forward_ptrs.emplace_back(nullptr);
-    nSize = 0;
 }
 
 //=============================================COMPARISON=======================================
@@ -557,27 +652,27 @@ bool operator<(const Map<Key_T,Mapped_T> &map1, const Map<Key_T,Mapped_T> &map2)
 
 template<typename Key_T, typename Mapped_T>
 typename Map<Key_T, Mapped_T>::ReverseIterator &Map<Key_T, Mapped_T>::ReverseIterator::operator++() {
-    current = current->prev;
+    current = current->previous();
     return *this;
 }
 
 template<typename Key_T, typename Mapped_T>
 typename Map<Key_T, Mapped_T>::ReverseIterator Map<Key_T, Mapped_T>::ReverseIterator::operator++(int n) {
     ReverseIterator prev(current);
-    current = current->prev;
+    current = current->previous();
     return prev;
 }
 
 template<typename Key_T, typename Mapped_T>
 typename Map<Key_T, Mapped_T>::ReverseIterator &Map<Key_T, Mapped_T>::ReverseIterator::operator--() {
-    current = current->forward_ptrs[0];
+    current = current->next(0);
     return *this;
 }
 
 template<typename Key_T, typename Mapped_T>
 typename Map<Key_T, Mapped_T>::ReverseIterator Map<Key_T, Mapped_T>::ReverseIterator::operator--(int n) {
     ReverseIterator prev(current);
-    current = current->forward_ptrs[0];
+    current = current->next(0);
     return prev;
 }
 
@@ -595,7 +690,7 @@ typename Map<Key_T, Mapped_T>::ValueType *Map<Key_T, Mapped_T>::ReverseIterator:
 template<typename Key_T, typename Mapped_T>
 typename Map<Key_T, Mapped_T>::ConstIterator Map<Key_T, Mapped_T>::ConstIterator::operator++(int n) {
     ConstIterator prev(current);
-    current = current->forward_ptrs[0];
+    current = current->next(0);
     return prev;
 }
 
@@ -606,20 +701,20 @@ Map<Key_T, Mapped_T>::ConstIterator::ConstIterator(const Map<Key_T, Mapped_T>::I
 
 template<typename Key_T, typename Mapped_T>
 typename Map<Key_T, Mapped_T>::ConstIterator &Map<Key_T, Mapped_T>::ConstIterator::operator++() {
-    current = current->forward_ptrs[0];
+    current = current->next(0);
     return *this;;
 }
 
 template<typename Key_T, typename Mapped_T>
 typename Map<Key_T, Mapped_T>::ConstIterator &Map<Key_T, Mapped_T>::ConstIterator::operator--() {
-    current = current->prev;
+    current = current->previous();
     return *this;;
 }
 
 template<typename Key_T, typename Mapped_T>
 typename Map<Key_T, Mapped_T>::ConstIterator Map<Key_T, Mapped_T>::ConstIterator::operator--(int n) {
     const SkipNode *prev = current;
-    current = current->prev;
+    current = current->previous();
     return ConstIterator(prev);
 }
 
@@ -636,27 +731,27 @@ const typename Map<Key_T, Mapped_T>::ValueType *Map<Key_T, Mapped_T>::ConstItera
 
 template<typename Key_T, typename Mapped_T>
 typename Map<Key_T, Mapped_T>::Iterator &Map<Key_T, Mapped_T>::Iterator::operator++() {
-    current = current->forward_ptrs[0];
+    current = current->next(0);
     return *this;
 }
 
 template<typename Key_T, typename Mapped_T>
 typename Map<Key_T, Mapped_T>::Iterator Map<Key_T, Mapped_T>::Iterator::operator++(int n) {
     SkipNode *previous = current;
-    current = current->forward_ptrs[0];
+    current = current->next(0);
     return Iterator(previous);
 }
 
 template<typename Key_T, typename Mapped_T>
 typename Map<Key_T, Mapped_T>::Iterator &Map<Key_T, Mapped_T>::Iterator::operator--() {
-    current = current->prev;
+    current = current->previous();
     return *this;
 }
 
 template<typename Key_T, typename Mapped_T>
 typename Map<Key_T, Mapped_T>::Iterator Map<Key_T, Mapped_T>::Iterator::operator--(int) {
     SkipNode *prev = current;
-    current = current->prev;
+    current = current->previous();
     return Iterator(prev);
 }
 
@@ -675,28 +770,186 @@ typename Map<Key_T, Mapped_T>::ValueType *Map<Key_T, Mapped_T>::Iterator::operat
 template<typename Key_T, typename Mapped_T>
 typename Map<Key_T, Mapped_T>::SkipNode *Map<Key_T, Mapped_T>::findNode(const Key_T & key) const {
     SkipNode *it = head;
-
-    for (long curr_ht_index = head->forward_ptrs.size() - 1; curr_ht_index >= 0; curr_ht_index--) {
-        while ((it->forward_ptrs[curr_ht_index] != tail) &&
-               (static_cast<DataNode *>(it->forward_ptrs[curr_ht_index])->data.first < key)) {
-            it = it->forward_ptrs[curr_ht_index];
+    SkipNode *bound = tail;     // where the level above stopped, known not to be less than the key
+    KeyPrefix<Key_T> prefix = prefixOf(key);
+
+    for (long curr_ht_index = levels.load(std::memory_order_acquire) - 1; curr_ht_index >= 0; curr_ht_index--) {
+        SkipNode *next = it->next(curr_ht_index);
+        while ((next != tail) && (next != bound) && keyLess(next, key, prefix)) {
+            it = next;
+            next = it->next(curr_ht_index);
         }
+        bound = next;
     }
 
-    it = it->forward_ptrs[0];
+    it = it->next(0);
 
-    if ((it != tail) && static_cast<DataNode *>(it)->data.first == key) {
+    if ((it != tail) && keyEquals(it, key, prefix)) {
         return it;
     } else
         return nullptr;
 }
 
+// A reader that started before the first insert sees no reference; its prefix then settles only
+// comparisons with keys that part from the reference at offset 0, which is still correct.
+template<typename Key_T, typename Mapped_T>
+KeyPrefix<Key_T> Map<Key_T, Mapped_T>::prefixOf(const Key_T &key) const {
+    return KeyPrefix<Key_T>(key, reference.load(std::memory_order_acquire));
+}
+
+template<typename Key_T, typename Mapped_T>
+bool Map<Key_T, Mapped_T>::keyLess(const SkipNode *node, const Key_T &key, const KeyPrefix<Key_T> &prefix) {
+    const DataNode *data = static_cast<const DataNode *>(node);
+    int cmp = data->prefix().compare(prefix);
+    if (cmp != 0)
+        return cmp < 0;
+    return data->data.first < key;
+}
+
+template<typename Key_T, typename Mapped_T>
+bool Map<Key_T, Mapped_T>::keyEquals(const SkipNode *node, const Key_T &key, const KeyPrefix<Key_T> &prefix) {
+    const DataNode *data = static_cast<const DataNode *>(node);
+    return data->prefix().compare(prefix) == 0 && data->data.first == key;
+}
+
+// Bytes reserved below a node for a tower of the given height, rounded so the node that follows
+// stays aligned.
+template<typename Key_T, typename Mapped_T>
+std::size_t Map<Key_T, Mapped_T>::towerBytes(std::size_t height, std::size_t align) {
+    std::size_t bytes = height * sizeof(std::atomic<SkipNode *>);
+    return (bytes + align - 1) / align * align;
+}
+
+template<typename Key_T, typename Mapped_T>
+typename Map<Key_T, Mapped_T>::SkipNode *Map<Key_T, Mapped_T>::newSentinel(char type) {
+    std::size_t tower = towerBytes(MAX_HEIGHT, alignof(SkipNode));
+    char *mem = static_cast<char *>(::operator new(tower + sizeof(SkipNode)));
+    for (std::size_t i = 0; i < MAX_HEIGHT; i++)
+        new (mem + tower - (i + 1) * sizeof(std::atomic<SkipNode *>)) std::atomic<SkipNode *>(nullptr);
+    return new (mem + tower) SkipNode(type, MAX_HEIGHT);
+}
+
+template<typename Key_T, typename Mapped_T>
+typename Map<Key_T, Mapped_T>::SkipNode *Map<Key_T, Mapped_T>::newDataNode(const std::pair<Key_T, Mapped_T> &pair, std::size_t height) {
+    std::size_t tower = towerBytes(height, alignof(DataNode));
+    char *mem = static_cast<char *>(::operator new(tower + sizeof(DataNode)));
+    DataNode *node;
+    try {
+        node = new (mem + tower) DataNode(pair, height, reference.load(std::memory_order_relaxed));
+    } catch (...) {
+        ::operator delete(mem);
+        throw;
+    }
+    for (std::size_t i = 0; i < height; i++)
+        new (mem + tower - (i + 1) * sizeof(std::atomic<SkipNode *>)) std::atomic<SkipNode *>(nullptr);
+    return node;
+}
+
+template<typename Key_T, typename Mapped_T>
+void Map<Key_T, Mapped_T>::deleteNode(SkipNode *node) {
+    char *mem = reinterpret_cast<char *>(node);
+    if (node->type == '\0') {
+        mem -= towerBytes(node->height, alignof(DataNode));
+        static_cast<DataNode *>(node)->~DataNode();
+    } else {
+        mem -= towerBytes(node->height, alignof(SkipNode));
+        node->~SkipNode();
+    }
+    ::operator delete(mem);
+}
+
+// Queues an unlinked node until no reader can still hold it. Outside concurrent-read mode the
+// node is freed immediately.
+template<typename Key_T, typename Mapped_T>
+void Map<Key_T, Mapped_T>::retire(SkipNode *node) {
+    if (!slots.load(std::memory_order_relaxed)) {
+        deleteNode(node);
+        return;
+    }
+    retired.push_back(std::pair<SkipNode *, std::uint64_t>(node, epoch.load(std::memory_order_relaxed)));
+    if (retired.size() >= RECLAIM_BATCH)
+        reclaim();
+}
+
+// Starts a new epoch and frees every retired node unlinked before the oldest epoch a reader is
+// still in. A reader that enters after the epoch is bumped cannot reach those nodes; the fence
+// pairs with the one in Reader::lock() so that a reader entering concurrently is either seen
+// here or sees the unlinks.
+template<typename Key_T, typename Mapped_T>
+void Map<Key_T, Mapped_T>::reclaim() {
+    epoch.store(epoch.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    std::uint64_t oldest = UINT64_MAX;
+    ReaderSlot *readers = slots.load(std::memory_order_acquire);
+    for (std::size_t i = 0; readers && i < MAX_READERS; i++) {
+        std::uint64_t entered = readers[i].epoch.load(std::memory_order_acquire);
+        if (entered != 0 && entered < oldest)
+            oldest = entered;
+    }
+
+    std::size_t kept = 0;
+    for (std::size_t i = 0; i < retired.size(); i++) {
+        if (retired[i].second < oldest)
+            deleteNode(retired[i].first);
+        else
+            retired[kept++] = retired[i];
+    }
+    retired.resize(kept);
+}
+
+template<typename Key_T, typename Mapped_T>
+std::size_t Map<Key_T, Mapped_T>::retiredCount() const {
+    return retired.size();
+}
+
+//============================================CONCURRENT READS===================================================
+
+// The slots are allocated with posix_memalign because operator new ignores alignas(64) before
+// C++17, and slots sharing a cache line would bounce between readers.
+template<typename Key_T, typename Mapped_T>
+void Map<Key_T, Mapped_T>::enableConcurrentReads() {
+    if (slots.load(std::memory_order_relaxed))
+        return;
+    void *mem;
+    if (posix_memalign(&mem, alignof(ReaderSlot), sizeof(ReaderSlot) * MAX_READERS) != 0)
+        throw std::bad_alloc();
+    ReaderSlot *readers = static_cast<ReaderSlot *>(mem);
+    for (std::size_t i = 0; i < MAX_READERS; i++)
+        new (&readers[i]) ReaderSlot();
+    slots.store(readers, std::memory_order_release);
+}
+
+template<typename Key_T, typename Mapped_T>
+Map<Key_T, Mapped_T>::Reader::Reader(const Map &m) : map(&m), slot(nullptr) {
+    ReaderSlot *readers = map->slots.load(std::memory_order_acquire);
+    if (!readers)
+        throw std::logic_error("Concurrent reads not enabled");
+    for (std::size_t i = 0; i < MAX_READERS; i++) {
+        bool expected = false;
+        if (readers[i].claimed.compare_exchange_strong(expected, true, std::memory_order_acquire)) {
+            slot = &readers[i];
+            return;
+        }
+    }
+    throw std::runtime_error("Too many readers");
+}
+
+template<typename Key_T, typename Mapped_T>
+Map<Key_T, Mapped_T>::Reader::~Reader() {
+    slot->epoch.store(0, std::memory_order_release);
+    slot->claimed.store(false, std::memory_order_release);
+}
+
+template<typename Key_T, typename Mapped_T>
+void Map<Key_T, Mapped_T>::Reader::lock() {
+    slot->epoch.store(map->epoch.load(std::memory_order_acquire), std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+}
+
 template<typename Key_T, typename Mapped_T>
-void Map<Key_T, Mapped_T>::addEmptyLayer() {
-    head->forward_ptrs.emplace_back(nullptr);
-    head->height++;
-    tail->forward_ptrs.emplace_back(nullptr);
-    tail->height++;
+void Map<Key_T, Mapped_T>::Reader::unlock() {
+    slot->epoch.store(0, std::memory_order_release);
 }
 
 
@@ -0,0 +1,98 @@
+// Measures JournaledMap write throughput, write amplification and recovery time.
+//     g++ -std=c++11 -O2 -pthread -I.. journal_bench.cpp && ./a.out [records]
+//
+// Write amplification is the bytes written to the log and snapshots divided by the bytes of
+// keys and values the workload handed in. Recovery is timed from the log alone and from a
+// snapshot plus a short log.
+#include "Journal.hpp"
+#include <chrono>
+#include <cstdio>
+
+typedef JournaledMap<std::string, std::string> Journaled;
+typedef std::chrono::steady_clock Clock;
+
+std::string base;
+
+void removeFiles()
+{
+    const char *suffixes[] = {".log", ".log.old", ".snap", ".snap.tmp"};
+    for (const char *suffix : suffixes)
+        ::unlink((base + suffix).c_str());
+}
+
+double millisSince(Clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+std::string keyFor(std::size_t i)
+{
+    return "https://example.com/api/v1/resources/" + std::to_string(i % 4096) + "/items/" + std::to_string(i);
+}
+
+// Applies records assigns spread over records/2 distinct keys, compacting every compactEvery records
+// (never if 0), and returns the bytes of keys and values written.
+std::uint64_t load(Journaled &map, std::size_t records, std::size_t compactEvery)
+{
+    std::uint64_t user = 0;
+    std::string value(64, 'v');
+    for (std::size_t i = 0; i < records; i++) {
+        std::string key = keyFor(i % std::max<std::size_t>(records / 2, 1));
+        map.assign(key, value);
+        user += key.size() + value.size();
+        if (compactEvery && (i + 1) % compactEvery == 0)
+            map.compact();
+    }
+    map.waitForCompaction();
+    return user;
+}
+
+void benchWrites(const char *name, Durability durability, std::size_t records, std::size_t compactEvery)
+{
+    removeFiles();
+    Journaled map(base, durability, 64);
+    Clock::time_point start = Clock::now();
+    std::uint64_t user = load(map, records, compactEvery);
+    map.sync();
+    double ms = millisSince(start);
+    JournalStats stats = map.stats();
+    std::printf("%-28s %9.1f ms %10.0f ops/s  log %8.1f KiB  snap %8.1f KiB  amplification %.2f  fsyncs %zu\n",
+                name, ms, records / (ms / 1000), stats.logBytes / 1024.0, stats.snapshotBytes / 1024.0,
+                double(stats.logBytes + stats.snapshotBytes) / user, stats.syncs);
+}
+
+void benchRecovery(const char *name, std::size_t records, bool snapshot)
+{
+    removeFiles();
+    {
+        Journaled map(base, Durability::None);
+        load(map, records, 0);
+        if (snapshot) {
+            map.compact();
+            map.waitForCompaction();
+            for (std::size_t i = 0; i < records / 100; i++)
+                map.assign(keyFor(i), "late");
+        }
+    }
+    Clock::time_point start = Clock::now();
+    Journaled map(base);
+    double ms = millisSince(start);
+    std::printf("%-28s %9.1f ms  %zu keys, %zu log records replayed\n",
+                name, ms, map.size(), map.stats().recovered);
+}
+
+int main(int argc, char **argv)
+{
+    std::size_t records = std::max<std::size_t>(argc > 1 ? std::stoul(argv[1]) : 200000, 100);
+    base = "/tmp/journal_bench_" + std::to_string(getpid());
+
+    benchWrites("writes, None", Durability::None, records, 0);
+    benchWrites("writes, Batched", Durability::Batched, records, 0);
+    benchWrites("writes, Batched + compact", Durability::Batched, records, records / 4);
+    benchWrites("writes, Always", Durability::Always, records / 100, 0);
+    benchRecovery("recovery, log only", records, false);
+    benchRecovery("recovery, snapshot + log", records, true);
+
+    removeFiles();
+    return 0;
+}
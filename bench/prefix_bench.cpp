@@ -0,0 +1,126 @@
+// Measures Map insert and find latency on string keys with and without the cached KeyPrefix.
+//     g++ -std=c++11 -O2 -I.. prefix_bench.cpp && ./a.out [keys]
+//
+// Three key types hold the same strings: ReferenceKey gets the reference-relative prefix that
+// std::string keys use, LeadingKey a prefix of just the first eight bytes, and PlainKey none at
+// all, so every comparison reads the key's heap buffer. Besides the time, each line reports how
+// many full key comparisons an operation needed. URL- and path-shaped keys share a long leading
+// run, which is where a leading-bytes prefix stops helping.
+#include "Map.hpp"
+#include <chrono>
+#include <cstdio>
+
+typedef std::chrono::steady_clock Clock;
+
+// Each key type counts the full comparisons the prefix failed to settle.
+template<typename Tag>
+struct Key {
+    std::string s;
+    static std::size_t compares;
+    friend bool operator<(const Key &a, const Key &b) { compares++; return a.s < b.s; }
+    friend bool operator==(const Key &a, const Key &b) { compares++; return a.s == b.s; }
+};
+template<typename Tag> std::size_t Key<Tag>::compares = 0;
+
+struct ReferenceTag {};
+struct LeadingTag {};
+struct PlainTag {};
+typedef Key<ReferenceTag> ReferenceKey;
+typedef Key<LeadingTag> LeadingKey;
+typedef Key<PlainTag> PlainKey;
+
+// The prefix std::string keys get.
+template<>
+struct KeyPrefix<ReferenceKey> : KeyPrefix<std::string> {
+    struct Reference {
+        std::string s;
+        explicit Reference(const ReferenceKey &key) : s(key.s) {}
+    };
+    KeyPrefix(const ReferenceKey &key, const Reference *reference)
+            : KeyPrefix<std::string>(key.s, reference ? &reference->s : nullptr) {}
+};
+
+// The first eight bytes only, packed big-endian.
+template<>
+struct KeyPrefix<LeadingKey> {
+    struct Reference {
+        explicit Reference(const LeadingKey &) {}
+    };
+    std::uint64_t value;
+    KeyPrefix(const LeadingKey &key, const Reference *) : value(0) {
+        for (std::size_t i = 0; i < sizeof(value); i++) {
+            value <<= 8;
+            if (i < key.s.size())
+                value |= static_cast<unsigned char>(key.s[i]);
+        }
+    }
+    int compare(const KeyPrefix &p) const {
+        return (value < p.value) ? -1 : (value > p.value);
+    }
+};
+
+double nanosPer(Clock::time_point start, std::size_t ops)
+{
+    return std::chrono::duration<double, std::nano>(Clock::now() - start).count() / ops;
+}
+
+// Inserts the keys in shuffled order, then looks every one up in a different order.
+template<typename K>
+void bench(const char *name, const std::vector<std::string> &strings)
+{
+    std::vector<K> keys;
+    for (const std::string &s : strings)
+        keys.push_back(K{s});
+    std::mt19937 rng(1);
+    std::shuffle(keys.begin(), keys.end(), rng);
+    srand(1);
+
+    Map<K, int> map;
+    K::compares = 0;
+    Clock::time_point start = Clock::now();
+    for (std::size_t i = 0; i < keys.size(); i++)
+        map.insert(std::pair<K, int>(keys[i], i));
+    double insertNs = nanosPer(start, keys.size());
+    double insertCompares = double(K::compares) / keys.size();
+
+    std::shuffle(keys.begin(), keys.end(), rng);
+    std::size_t found = 0;
+    K::compares = 0;
+    start = Clock::now();
+    for (int round = 0; round < 3; round++) {
+        for (const K &key : keys)
+            found += map.find(key) != map.end();
+    }
+    double findNs = nanosPer(start, 3 * keys.size());
+    double findCompares = double(K::compares) / (3 * keys.size());
+    assert(found == 3 * keys.size());
+    std::printf("  %-12s insert %7.1f ns %5.1f compares   find %7.1f ns %5.1f compares\n",
+                name, insertNs, insertCompares, findNs, findCompares);
+}
+
+void benchAll(const char *shape, const std::vector<std::string> &strings)
+{
+    std::printf("%s, %zu keys\n", shape, strings.size());
+    bench<ReferenceKey>("reference", strings);
+    bench<LeadingKey>("leading 8", strings);
+    bench<PlainKey>("no prefix", strings);
+}
+
+int main(int argc, char **argv)
+{
+    std::size_t count = argc > 1 ? std::stoul(argv[1]) : 200000;
+    std::vector<std::string> urls, paths, random;
+    std::mt19937 rng(7);
+    for (std::size_t i = 0; i < count; i++) {
+        urls.push_back("https://example.com/api/v1/resources/" + std::to_string(i % 4096) + "/items/" + std::to_string(i));
+        paths.push_back("/usr/local/share/doc/package-" + std::to_string(rng() % 100000) + "/file-" + std::to_string(i));
+        std::string key;
+        for (int n = 0; n < 16; n++)
+            key.push_back('a' + rng() % 26);
+        random.push_back(key);
+    }
+    benchAll("URL keys", urls);
+    benchAll("path keys", paths);
+    benchAll("random keys", random);
+    return 0;
+}
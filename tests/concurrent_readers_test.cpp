@@ -0,0 +1,104 @@
+// Stress test for single-writer/multi-reader mode: one writer inserts, erases and clears while
+// several readers look keys up and walk the map. Build it twice:
+//     g++ -std=c++11 -O1 -g -pthread -fsanitize=address,undefined -I.. concurrent_readers_test.cpp
+//     g++ -std=c++11 -O1 -g -pthread -fsanitize=thread -I.. concurrent_readers_test.cpp
+// AddressSanitizer catches a node freed while a reader can still reach it. ThreadSanitizer
+// checks the link publication, but it does not model atomic_thread_fence, so it cannot check
+// the Reader::lock()/reclaim() handshake and may report races there that the fences rule out.
+#include "Map.hpp"
+#include <thread>
+#include <mutex>
+
+const int READERS=6,KEYS=256,OPS=300000;
+
+// Nodes erased while a reader is locked stay allocated until it unlocks, then drain.
+void testPinnedNodes()
+{
+    typedef Map<int, std::string> Strings;
+    Strings map;
+    map.enableConcurrentReads();
+    for (int key = 0; key < KEYS; key++)
+        map.insert(std::pair<int, std::string>(key, std::to_string(key)));
+    std::atomic<int> stage(0);
+    std::thread reader([&map, &stage] {
+        Strings::Reader reader(map);
+        const Strings &view = map;
+        reader.lock();
+        auto it = view.find(7);
+        stage.store(1);
+        while (stage.load() != 2)
+            std::this_thread::yield();
+        assert(it->first == 7 && it->second == "7");
+        reader.unlock();
+        stage.store(3);
+    });
+    while (stage.load() != 1)
+        std::this_thread::yield();
+    for (int key = 0; key < KEYS; key++)
+        map.erase(key);
+    map.reclaim();
+    assert(map.retiredCount() == static_cast<std::size_t>(KEYS));
+    stage.store(2);
+    while (stage.load() != 3)
+        std::this_thread::yield();
+    map.reclaim();
+    assert(map.retiredCount() == 0);
+    reader.join();
+}
+
+int main()
+{
+    testPinnedNodes();
+
+    Map<int, int> map;
+    map.enableConcurrentReads();
+    std::atomic<bool> stop(false);
+    std::vector<std::thread> readers;
+
+    for (int t = 0; t < READERS; t++) {
+        readers.emplace_back([&map, &stop] {
+            Map<int, int>::Reader reader(map);
+            const Map<int, int> &view = map;
+            while (!stop.load()) {
+                std::lock_guard<Map<int, int>::Reader> guard(reader);
+                for (int key = 0; key < KEYS; key += 3) {
+                    auto it = view.find(key);
+                    if (it != view.end())
+                        assert(it->first == key && it->second == key * 2);
+                }
+                int prev = -1;
+                for (auto it = view.begin(); it != view.end(); it++) {
+                    assert(it->first > prev && it->second == it->first * 2);
+                    prev = it->first;
+                }
+            }
+        });
+    }
+
+    srand(1);
+    for (int i = 0; i < OPS; i++) {
+        int key = rand() % KEYS;
+        if (rand() % 2)
+            map.insert(std::pair<int, int>(key, key * 2));
+        else if (map.find(key) != map.end())
+            map.erase(key);
+        if (i % 50000 == 0)
+            map.clear();
+    }
+    stop.store(true);
+    for (auto &reader : readers)
+        reader.join();
+    map.reclaim();
+    assert(map.retiredCount() == 0);
+
+    bool threw = false;
+    Map<int, int> plain;
+    try {
+        Map<int, int>::Reader reader(plain);
+    } catch (std::logic_error &) {
+        threw = true;
+    }
+    assert(threw);
+    std::cout << "ok" << std::endl;
+    return 0;
+}
@@ -0,0 +1,282 @@
+// Crash-recovery tests for JournaledMap. Each case mutates a journaled map alongside a std::map
+// model, "crashes" by calling _exit in a forked child or by damaging the files directly, and
+// checks that recovery rebuilds exactly the model.
+//     g++ -std=c++11 -O1 -g -pthread -I.. journal_test.cpp
+#include "Journal.hpp"
+#include <map>
+#include <csignal>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+typedef JournaledMap<std::string, int> Journaled;
+typedef std::map<std::string, int> Model;
+
+std::string base;
+
+void removeFiles()
+{
+    const char *suffixes[] = {".log", ".log.old", ".snap", ".snap.tmp"};
+    for (const char *suffix : suffixes)
+        ::unlink((base + suffix).c_str());
+    ::rmdir((base + ".snap.tmp").c_str());
+}
+
+void check(const Journaled &map, const Model &model)
+{
+    assert(map.size() == model.size());
+    auto it = map.map().begin();
+    for (auto &item : model) {
+        assert(it->first == item.first && it->second == item.second);
+        it++;
+    }
+    assert(it == map.map().end());
+}
+
+// Runs body in a child process. body ends with crash() while its map is still alive, so no
+// destructor gets to flush or sync anything.
+void crash()
+{
+    _exit(0);
+}
+
+template<typename F>
+void crashAfter(F body)
+{
+    pid_t pid = fork();
+    if (pid == 0) {
+        body();
+        _exit(1);
+    }
+    int status;
+    waitpid(pid, &status, 0);
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+}
+
+// Batched is the default level: records must reach the OS even before the group fsync.
+void testBatchedProcessCrash()
+{
+    removeFiles();
+    Model model;
+    crashAfter([] {
+        Journaled map(base, Durability::Batched, 64);
+        for (int i = 0; i < 10; i++)
+            map.assign("/batched/" + std::to_string(i), i);
+        map.erase("/batched/3");
+        crash();
+    });
+    for (int i = 0; i < 10; i++)
+        model["/batched/" + std::to_string(i)] = i;
+    model.erase("/batched/3");
+    Journaled map(base);
+    check(map, model);
+}
+
+void testTornTail()
+{
+    removeFiles();
+    Model model;
+    {
+        Journaled map(base, Durability::Always);
+        map.assign("/kept", 1);
+        map.assign("/torn", 2);
+    }
+    model["/kept"] = 1;
+    struct stat st;
+    ::stat((base + ".log").c_str(), &st);
+    assert(::truncate((base + ".log").c_str(), st.st_size - 2) == 0);
+    {
+        Journaled map(base);
+        check(map, model);
+        map.assign("/after", 3);
+    }
+    model["/after"] = 3;
+    Journaled map(base);
+    check(map, model);
+}
+
+void testClearReplay()
+{
+    removeFiles();
+    Model model;
+    {
+        Journaled map(base, Durability::Always);
+        map.assign("/before", 1);
+        map.compact();
+        map.waitForCompaction();
+        map.assign("/cleared", 2);
+    }
+    crashAfter([] {
+        Journaled map(base, Durability::Always);
+        map.clear();
+        map.assign("/after", 3);
+        map.assign("/before", 4);
+        crash();
+    });
+    model["/after"] = 3;
+    model["/before"] = 4;
+    Journaled map(base);
+    check(map, model);
+}
+
+// A crash between rotating the log and finishing the snapshot leaves <path>.log.old behind.
+void testInterruptedCompaction()
+{
+    removeFiles();
+    Model model;
+    {
+        Journaled map(base, Durability::Always);
+        map.assign("/old", 1);
+        map.assign("/both", 1);
+    }
+    assert(::rename((base + ".log").c_str(), (base + ".log.old").c_str()) == 0);
+    {
+        Journaled map(base, Durability::Always);
+        map.assign("/new", 2);
+        map.assign("/both", 2);
+    }
+    model["/old"] = 1;
+    model["/new"] = 2;
+    model["/both"] = 2;
+    {
+        Journaled map(base);
+        check(map, model);
+        map.assign("/later", 3);
+    }
+    model["/later"] = 3;
+    Journaled map(base);
+    check(map, model);
+}
+
+// Two failed compactions in a row must not rotate the live log over the old one.
+void testFailedCompaction()
+{
+    removeFiles();
+    assert(::mkdir((base + ".snap.tmp").c_str(), 0755) == 0);
+    crashAfter([] {
+        Journaled map(base, Durability::Always);
+        map.assign("a", 1);
+        map.compact();
+        bool threw = false;
+        try {
+            map.waitForCompaction();
+        } catch (std::system_error &) {
+            threw = true;
+        }
+        assert(threw);
+        map.assign("b", 2);
+        map.compact();
+        threw = false;
+        try {
+            map.waitForCompaction();
+        } catch (std::system_error &) {
+            threw = true;
+        }
+        assert(threw);
+        map.assign("c", 3);
+        crash();
+    });
+    ::rmdir((base + ".snap.tmp").c_str());
+    Model model;
+    model["a"] = 1;
+    model["b"] = 2;
+    model["c"] = 3;
+    Journaled map(base);
+    check(map, model);
+}
+
+// The writer keeps mutating while the compaction thread snapshots the map. The workload has its
+// own generator because the Map draws tower heights from rand().
+void testCompactionUnderWrites()
+{
+    removeFiles();
+    std::mt19937 rng(7);
+    Model model;
+    for (int i = 0; i < 20000; i++) {
+        std::string key = "/busy/" + std::to_string(rng() % 1000);
+        if (rng() % 4 == 0)
+            model.erase(key);
+        else
+            model[key] = i;
+    }
+    crashAfter([] {
+        std::mt19937 rng(7);
+        Journaled map(base, Durability::Batched, 128);
+        for (int i = 0; i < 20000; i++) {
+            std::string key = "/busy/" + std::to_string(rng() % 1000);
+            if (rng() % 4 == 0) {
+                if (map.find(key) != map.map().end())
+                    map.erase(key);
+            } else {
+                map.assign(key, i);
+            }
+            if (i % 5000 == 0)
+                map.compact();
+        }
+        map.waitForCompaction();
+        crash();
+    });
+    Journaled map(base);
+    check(map, model);
+}
+
+// A write cut short by the file size limit must not leave a torn record in the middle of the
+// log, or every record appended after it would be lost on recovery.
+void testPartialWrite()
+{
+    removeFiles();
+    crashAfter([] {
+        Journaled map(base, Durability::Batched, 64);
+        map.assign("/before", 1);
+        struct stat st;
+        ::stat((base + ".log").c_str(), &st);
+        struct rlimit saved, limit;
+        ::getrlimit(RLIMIT_FSIZE, &saved);
+        limit = saved;
+        limit.rlim_cur = st.st_size + 10;
+        std::signal(SIGXFSZ, SIG_IGN);
+        assert(::setrlimit(RLIMIT_FSIZE, &limit) == 0);
+        bool threw = false;
+        try {
+            map.assign("/failed/" + std::string(100, 'x'), 2);
+        } catch (std::system_error &) {
+            threw = true;
+        }
+        assert(threw && map.find("/failed/" + std::string(100, 'x')) == map.map().end());
+        assert(::setrlimit(RLIMIT_FSIZE, &saved) == 0);
+        map.assign("/after", 3);
+        crash();
+    });
+    Model model;
+    model["/before"] = 1;
+    model["/after"] = 3;
+    Journaled map(base);
+    check(map, model);
+}
+
+// Batched must not leave a lone record unsynced for longer than maxDelay.
+void testBatchedDelay()
+{
+    removeFiles();
+    Journaled map(base, Durability::Batched, 1000, std::chrono::milliseconds(10));
+    map.assign("/lonely", 1);
+    for (int i = 0; i < 200 && map.stats().syncs == 0; i++)
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    assert(map.stats().syncs > 0);
+}
+
+int main()
+{
+    base = "/tmp/journal_test_" + std::to_string(getpid());
+    testBatchedProcessCrash();
+    testTornTail();
+    testClearReplay();
+    testInterruptedCompaction();
+    testFailedCompaction();
+    testCompactionUnderWrites();
+    testPartialWrite();
+    testBatchedDelay();
+    removeFiles();
+    std::cout << "ok" << std::endl;
+    return 0;
+}
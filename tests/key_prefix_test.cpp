@@ -0,0 +1,98 @@
+// Ordering tests for KeyPrefix<std::string>: whenever two prefixes decide, they must agree with
+// std::string::operator<, whatever reference they were taken against. The keys include embedded
+// '\0's, bytes of 0x80 and above, long shared runs, and keys that are prefixes of each other.
+//     g++ -std=c++11 -O1 -g -fsanitize=address,undefined -I.. key_prefix_test.cpp
+#include "Map.hpp"
+#include <map>
+
+typedef KeyPrefix<std::string> Prefix;
+
+std::vector<std::string> edgeKeys()
+{
+    std::string run = "https://example.com/api/v1/resources/";
+    std::vector<std::string> keys = {
+        "", std::string(1, '\0'), std::string(2, '\0'), "a", std::string("a\0", 2),
+        std::string("a\0b", 3), "ab", "\x80", "\xff", "\x7f", std::string("\xff\0", 2),
+        "abcdefgh", "abcdefghi", "abcdefgh\x01", std::string("abcdefgh\0", 9), "abcdefgi",
+        "abcdefghijklmnop", "abcdefghijklmnoq", "abcdefghijklmno\xf0",
+        run, run + "1", run + "12", run + "12/items/3", run + "12/items/4", run + "12/items/\x80",
+        run + std::string("12\0", 3), run + "13", run + "\xc3\xa9", run.substr(0, 20),
+        "/usr/local/lib", "/usr/local/lib64", "/usr/local/libexec", "/usr/local/li",
+    };
+    std::mt19937 rng(11);
+    const char alphabet[] = {'\0', '\x01', 'a', 'b', '\x7f', '\x80', '\xfe', '\xff'};
+    for (int i = 0; i < 150; i++) {
+        std::string key = (rng() % 2) ? run.substr(0, rng() % (run.size() + 1)) : "";
+        for (std::size_t n = rng() % 14; n > 0; n--)
+            key.push_back(alphabet[rng() % sizeof(alphabet)]);
+        keys.push_back(key);
+    }
+    return keys;
+}
+
+int sign(int v)
+{
+    return (v > 0) - (v < 0);
+}
+
+// Prefixes taken against the same reference never contradict the keys, and a missing reference
+// (a reader that started before the first insert) mixes safely with any other.
+void testPairwiseOrder(const std::vector<std::string> &keys)
+{
+    std::vector<const std::string *> references = {nullptr};
+    for (std::size_t i = 0; i < keys.size(); i += 7)
+        references.push_back(&keys[i]);
+    for (const std::string *reference : references) {
+        for (const std::string &a : keys) {
+            Prefix pa(a, reference), none(a, nullptr);
+            for (const std::string &b : keys) {
+                Prefix pb(b, reference);
+                int expected = sign(a.compare(b));
+                int got = pa.compare(pb);
+                assert(got == 0 || got == expected);
+                assert(pb.compare(pa) == -got);
+                int mixed = none.compare(pb);
+                assert(mixed == 0 || mixed == expected);
+                assert(pb.compare(none) == -mixed);
+            }
+        }
+    }
+}
+
+// The same keys through the Map, with references picked from varied first keys.
+void testMapOrder(const std::vector<std::string> &keys)
+{
+    std::mt19937 rng(5);
+    for (int round = 0; round < 20; round++) {
+        Map<std::string, int> map;
+        std::map<std::string, int> model;
+        for (int i = 0; i < 2000; i++) {
+            const std::string &key = keys[rng() % keys.size()];
+            if (rng() % 3) {
+                map.insert(std::pair<std::string, int>(key, i));
+                model.insert(std::pair<std::string, int>(key, i));
+            } else if (model.erase(key)) {
+                map.erase(key);
+            }
+            assert((map.find(key) != map.end()) == (model.count(key) == 1));
+        }
+        assert(map.size() == model.size());
+        auto it = map.begin();
+        for (auto &item : model) {
+            assert(it->first == item.first && it->second == item.second);
+            it++;
+        }
+        Map<std::string, int> copy(map);
+        for (auto &item : model)
+            assert(copy.at(item.first) == item.second);
+    }
+}
+
+int main()
+{
+    std::vector<std::string> keys = edgeKeys();
+    testPairwiseOrder(keys);
+    testMapOrder(keys);
+    std::cout << "ok" << std::endl;
+    return 0;
+}